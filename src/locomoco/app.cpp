@@ -1,6 +1,15 @@
 #include "app.h"
 
 namespace lm {
+IAppMessage* CreateAppMessage(const MessageLogRecord& record) {
+    switch (static_cast<AppMessageType>(record.type)) {
+    case AppMessageType::ResizeWindow:
+        return ResizeWindowMessage::Deserialize(record.payload);
+    default:
+        return nullptr;
+    }
+}
+
 bool App::Inititialize(const AppInitializeParams& params) {
     if (!m_renderer.InitializeDirectX()) {
         MessageBox(nullptr, L"InitializeDirectX failed.", L"Error", MB_OK);
@@ -12,14 +21,37 @@ bool App::Inititialize(const AppInitializeParams& params) {
     }
     m_renderer.InitializeImGui(params.hWnd);
     ImGui::GetIO().ConfigInputTrickleEventQueue = false;
+
+    if (!params.replayPath.empty()) {
+        if (!m_replayer.Open(params.replayPath)) {
+            MessageBox(nullptr, L"Opening replay log failed.", L"Error", MB_OK);
+            return false;
+        }
+        m_isReplayRealTime = params.isReplayRealTime;
+        // Don't overwrite the frame times of the recorded session.
+        m_frameTimesPath = params.frameTimesPath.empty() ? params.replayPath + L".replay.frames.csv" : params.frameTimesPath;
+    }
+    else if (!params.recordPath.empty()) {
+        if (!m_recorder.Open(params.recordPath)) {
+            MessageBox(nullptr, L"Opening record log failed.", L"Error", MB_OK);
+            return false;
+        }
+        m_frameTimesPath = params.frameTimesPath.empty() ? params.recordPath + L".frames.csv" : params.frameTimesPath;
+    }
+    // Replay is always paced by frames so that the results are comparable.
+    m_framePacer.Initialize(params.isOnDemandRedraw && !m_replayer.IsOpen(), params.idleMaxFps, params.idleMinFps);
+    m_startTime = Clock::now();
     return true;
 }
 
 void App::Finalize() {
     m_renderer.Finalize();
+    m_recorder.Close(m_frameIndex, GetElapsedMicroseconds());
+    WriteFrameTimes();
 }
 
 void App::Update() {
+    m_frameStartTime = Clock::now();
     m_frameState = AppFrameState();
     ProcessMessages();
 }
@@ -33,10 +65,75 @@ void App::Draw() {
     }
     m_renderer.BeginFrame();
 
-
+    // Scene rendering goes here. Set m_frameState.isSceneDirty when it changes the image,
+    // and m_frameState.isAnimating while it needs more frames.
 
     ImGui::ShowDemoWindow();
     
-    m_renderer.EndFrame();
+    // Replaying as fast as possible must not be capped by vsync.
+    bool waitForVSync = !m_replayer.IsOpen() || m_isReplayRealTime;
+    bool isPresented = m_renderer.EndFrame(m_framePacer.IsOnDemand(), m_frameState.isSceneDirty, waitForVSync);
+    m_framePacer.EndFrame(isPresented, m_frameState.isAnimating);
+
+    if (!m_frameTimesPath.empty()) {
+        auto endTime = Clock::now();
+        auto cpuEndTime = isPresented ? m_renderer.GetLastSubmitTime() : endTime;
+        FrameTime frameTime{};
+        frameTime.cpu = std::chrono::duration_cast<std::chrono::microseconds>(cpuEndTime - m_frameStartTime).count();
+        frameTime.total = std::chrono::duration_cast<std::chrono::microseconds>(endTime - m_frameStartTime).count();
+        m_frameTimes.push_back(frameTime);
+    }
+    if (m_recorder.IsOpen()) {
+        m_recorder.Flush();
+    }
+    m_frameIndex++;
+}
+
+void App::RecordMessage(const IAppMessage& message) {
+    if (!m_recorder.IsOpen()) {
+        return;
+    }
+    MessageLogRecord record{};
+    record.frameIndex = m_frameIndex;
+    record.timestamp = GetElapsedMicroseconds();
+    record.type = static_cast<uint16_t>(message.GetType());
+    message.Serialize(record.payload);
+    m_recorder.Write(record);
+}
+
+void App::ReplayMessages() {
+    if (!m_replayer.IsOpen()) {
+        return;
+    }
+    auto timestamp = GetElapsedMicroseconds();
+    while (auto* pRecord = m_replayer.Next(m_frameIndex, timestamp, m_isReplayRealTime)) {
+        auto* pMessage = CreateAppMessage(*pRecord);
+        if (pMessage == nullptr) {
+            DEBUG_PRINT(L"Unknown message in replay log: %d\n", pRecord->type);
+            continue;
+        }
+        pMessage->UpdateState(m_state, m_frameState);
+        delete pMessage;
+    }
+}
+
+// Writes "frame,cpu,total" lines in microseconds so that frame times can be compared between builds.
+void App::WriteFrameTimes() {
+    if (m_frameTimesPath.empty()) {
+        return;
+    }
+    std::ofstream stream(m_frameTimesPath, std::ios::trunc);
+    if (!stream) {
+        DEBUG_PRINT(L"Writing frame times failed: %s\n", m_frameTimesPath.c_str());
+        return;
+    }
+    stream << "frame,cpu,total\n";
+    for (size_t i = 0; i < m_frameTimes.size(); i++) {
+        stream << i << "," << m_frameTimes[i].cpu << "," << m_frameTimes[i].total << "\n";
+    }
+}
+
+int64_t App::GetElapsedMicroseconds() const {
+    return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - m_startTime).count();
 }
 }
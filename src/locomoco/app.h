@@ -1,7 +1,13 @@
 #pragma once
+#include <chrono>
+#include <cstring>
 #include <mutex>
 #include <queue>
+#include <string>
+#include <vector>
 #include <Windows.h>
+#include "frame_pacer.h"
+#include "message_log.h"
 #include "renderer.h"
 
 namespace lm {
@@ -37,14 +43,28 @@ public:
 class AppFrameState {
 public:
     bool isWindowSizeDirty{};
+    bool isSceneDirty{}; // the scene image changed; the frame is presented even if the UI is unchanged
+    bool isAnimating{}; // the scene needs more frames without input (e.g. progressive rendering)
 };
 
+// Identifies message classes in a message log. Don't change the values of existing entries.
+enum class AppMessageType : uint16_t {
+    EndOfSession = 0, // reserved for MessageLogFormat::EndOfSessionType; never assign it to a message
+    ResizeWindow = 1,
+};
+static_assert(static_cast<uint16_t>(AppMessageType::EndOfSession) == MessageLogFormat::EndOfSessionType);
+
 class IAppMessage {
 public:
     virtual ~IAppMessage() {}
 
     // Destructively mutates AppState.
     virtual void UpdateState(AppState& state, AppFrameState& frameState) = 0;
+
+    virtual AppMessageType GetType() const = 0;
+
+    // Appends the message parameters to payload so that CreateAppMessage() can restore the message.
+    virtual void Serialize(std::vector<uint8_t>& payload) const = 0;
 };
 
 class ResizeWindowMessage : public IAppMessage {
@@ -56,6 +76,24 @@ public:
         state.windowHeight = m_height;
         frameState.isWindowSizeDirty = true;
     }
+
+    virtual AppMessageType GetType() const override { return AppMessageType::ResizeWindow; }
+
+    virtual void Serialize(std::vector<uint8_t>& payload) const override {
+        int32_t values[] = { m_width, m_height };
+        const auto* pBytes = reinterpret_cast<const uint8_t*>(values);
+        payload.insert(payload.end(), pBytes, pBytes + sizeof(values));
+    }
+
+    // Returns nullptr if payload is malformed.
+    static IAppMessage* Deserialize(const std::vector<uint8_t>& payload) {
+        int32_t values[2]{};
+        if (payload.size() != sizeof(values)) {
+            return nullptr;
+        }
+        std::memcpy(values, payload.data(), sizeof(values));
+        return new ResizeWindowMessage(values[0], values[1]);
+    }
 private:
     int m_width{};
     int m_height{};
@@ -66,8 +104,18 @@ public:
     HWND hWnd{}; // hWnd for main window
     int width; // width of main window
     int height; // height of main window
+    std::wstring recordPath{}; // records messages to this file if not empty
+    std::wstring replayPath{}; // replays messages from this file if not empty
+    bool isReplayRealTime{}; // replays at the original timing instead of as fast as possible
+    std::wstring frameTimesPath{}; // writes frame times here when recording or replaying; derived from the log path if empty
+    bool isOnDemandRedraw{}; // renders only when something may have changed instead of continuously
+    int idleMaxFps{ 10 }; // frame rate cap of frames not caused by input (animations) in on-demand redraw mode
+    int idleMinFps{ 2 }; // wake-up rate without input in on-demand redraw mode, for time-based UI; 0 disables
 };
 
+// Restores a message from a message log record. Returns nullptr if the record is unknown or malformed.
+IAppMessage* CreateAppMessage(const MessageLogRecord& record);
+
 class App {
 public:
     // Must be called just once.
@@ -76,6 +124,12 @@ public:
     // Must be called just once after Initialize().
     void Finalize();
 
+    // Must be called from main thread.
+    // Blocks until the next frame should be processed. Returns immediately unless in on-demand redraw mode.
+    void WaitForNextFrame() {
+        m_framePacer.WaitForNextFrame();
+    }
+
     // Must be called from main thread.
     // Processes CPU related tasks.
     void Update();
@@ -88,19 +142,64 @@ public:
     // Don't delete the argument because the lifetime of the argument is managed by App. (Ownership moves to the App.)
     void PushMessage(IAppMessage* pMessage) {
         m_messageQueue.push(pMessage);
+        m_framePacer.RequestRedraw();
+    }
+
+    // Thread safe.
+    // Wakes up WaitForNextFrame() (e.g. on window input which ImGui may react to).
+    void RequestRedraw() {
+        m_framePacer.RequestRedraw();
+    }
+
+    // Returns true when the replayed session has reached the frame (or the time with isReplayRealTime) at which
+    // the recording stopped.
+    bool IsReplayFinished() const {
+        return m_replayer.IsOpen() && m_replayer.IsFinished(m_frameIndex, GetElapsedMicroseconds(), m_isReplayRealTime);
     }
 private:
+    using Clock = std::chrono::steady_clock;
+
+    // Microseconds spent in a frame
+    class FrameTime {
+    public:
+        int64_t cpu{}; // from Update() until the command list is submitted
+        int64_t total{}; // including the wait for the GPU and present
+    };
+
     ConcurrentQueue<IAppMessage*> m_messageQueue{};
     AppState m_state{}; // stable over frames.
     AppFrameState m_frameState{}; // cleared every frame.
     Renderer m_renderer{};
+    FramePacer m_framePacer{};
+
+    // Message recording and replaying
+    MessageRecorder m_recorder{};
+    MessageReplayer m_replayer{};
+    bool m_isReplayRealTime{};
+    std::wstring m_frameTimesPath{}; // frame times are written here on Finalize() if not empty
+    std::vector<FrameTime> m_frameTimes{};
+    uint32_t m_frameIndex{};
+    Clock::time_point m_startTime{};
+    Clock::time_point m_frameStartTime{};
 
     void ProcessMessages() {
         while (!m_messageQueue.empty()) {
             auto* pMessage = m_messageQueue.pop();
+            if (m_replayer.IsOpen()) {
+                // Live messages are dropped so that they don't disturb the replayed session.
+                delete pMessage;
+                continue;
+            }
+            RecordMessage(*pMessage);
             pMessage->UpdateState(m_state, m_frameState);
             delete pMessage;
         }
+        ReplayMessages();
     }
+
+    void RecordMessage(const IAppMessage& message);
+    void ReplayMessages();
+    void WriteFrameTimes();
+    int64_t GetElapsedMicroseconds() const;
 };
 }
\ No newline at end of file
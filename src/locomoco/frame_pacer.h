@@ -0,0 +1,187 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <Windows.h>
+#include "utility.h"
+
+namespace lm {
+
+// Decides when the app loop runs the next frame.
+// In on-demand mode the loop sleeps until a redraw is requested (messages, input). A requested frame runs
+// immediately. Frames which are not caused by a request (the UI still changing after a present, or the scene
+// animating, e.g. progressive rendering) run at most idleMaxFps times per second. While nothing changes the loop
+// also wakes up idleMinFps times per second (0: never) so that time-based UI such as tooltips and the text cursor
+// updates without input.
+// In on-demand mode, also reports CPU usage and request-to-present latency on the debug console once per second.
+class FramePacer {
+public:
+    ~FramePacer() {
+        CloseHandle(m_hRedrawEvent);
+    }
+
+    void Initialize(bool isOnDemand, int idleMaxFps, int idleMinFps) {
+        m_isOnDemand = isOnDemand;
+        // At least 1 ms; waiting 0 ms would spin.
+        m_maxFrameIntervalMs = (std::max)(1000 / (std::max)(idleMaxFps, 1), 1);
+        m_idleWakeIntervalMs = idleMinFps > 0 ? (std::max)(1000 / idleMinFps, 1) : INFINITE;
+        m_pendingFrameCount = SettleFrameCount; // the first frames run without a request
+        m_reportStartTime = Clock::now();
+        m_reportStartCpuTime = GetProcessCpuTime();
+    }
+
+    // Thread safe.
+    void RequestRedraw() {
+        {
+            std::lock_guard<std::mutex> lock(m_requestMutex);
+            if (m_requestCount == 0) {
+                m_requestTime = Now();
+            }
+            m_requestCount++;
+        }
+        SetEvent(m_hRedrawEvent);
+    }
+
+    // Blocks until the next frame should run. Returns immediately if not in on-demand mode.
+    void WaitForNextFrame() {
+        if (m_isOnDemand) {
+            DWORD timeoutMs = m_idleWakeIntervalMs;
+            if (m_pendingFrameCount > 0 || m_isAnimating) {
+                int64_t elapsedMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    Clock::now() - m_frameStartTime).count();
+                int64_t remainingMs = static_cast<int64_t>(m_maxFrameIntervalMs) - elapsedMs;
+                timeoutMs = static_cast<DWORD>((std::max)(remainingMs, int64_t{ 0 }));
+            }
+            if (WaitForSingleObject(m_hRedrawEvent, timeoutMs) == WAIT_OBJECT_0) {
+                // ImGui may take a few frames to reflect an input.
+                m_pendingFrameCount = SettleFrameCount;
+            }
+            else if (m_pendingFrameCount > 0) {
+                m_pendingFrameCount--;
+            }
+        }
+        m_frameStartTime = Clock::now();
+        TakeRequests();
+    }
+
+    // Must be called after each frame with whether the frame was presented, and whether the scene needs more
+    // frames even if nothing is requested (e.g. progressive rendering).
+    void EndFrame(bool isPresented, bool isAnimating = false) {
+        m_isAnimating = isAnimating;
+        m_frameCount++;
+        if (isPresented) {
+            m_presentCount++;
+            m_pendingFrameCount = SettleFrameCount;
+            if (m_frameRequestCount > 0) {
+                int64_t latency = Now() - m_frameRequestTime;
+                m_latencyCount++;
+                m_latencySum += latency;
+                m_latencyMax = (std::max)(m_latencyMax, latency);
+                m_requestStatCount += m_frameRequestCount;
+                m_frameRequestCount = 0;
+            }
+        }
+        else if (m_pendingFrameCount == 0 && !m_isAnimating) {
+            // Going idle. The requests didn't change anything on screen.
+            m_frameRequestCount = 0;
+        }
+        if (m_isOnDemand) {
+            Report();
+        }
+    }
+
+    bool IsOnDemand() const { return m_isOnDemand; }
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // Number of extra frames run after a wake-up or a presented frame.
+    static const int SettleFrameCount = 2;
+
+    HANDLE m_hRedrawEvent{ CreateEvent(nullptr, FALSE, FALSE, nullptr) }; // auto-reset
+    bool m_isOnDemand{};
+    DWORD m_maxFrameIntervalMs{}; // minimum interval between frames which are not requested
+    DWORD m_idleWakeIntervalMs{}; // INFINITE if the loop never wakes up by itself
+    int m_pendingFrameCount{};
+    bool m_isAnimating{};
+    Clock::time_point m_frameStartTime{};
+
+    // Requests made since the last frame started. Guarded by m_requestMutex.
+    std::mutex m_requestMutex{};
+    int64_t m_requestTime{}; // microseconds; the oldest request
+    int m_requestCount{};
+
+    // Requests which the current frame reflects, including those of earlier frames which weren't presented.
+    int64_t m_frameRequestTime{}; // microseconds; the oldest request
+    int m_frameRequestCount{};
+
+    // Statistics since the last report
+    Clock::time_point m_reportStartTime{};
+    int64_t m_reportStartCpuTime{};
+    int m_frameCount{};
+    int m_presentCount{};
+    int m_requestStatCount{};
+    int m_latencyCount{};
+    int64_t m_latencySum{};
+    int64_t m_latencyMax{};
+
+    // Moves the requests made so far to the current frame.
+    // Only requests made before the frame starts can be reflected by the input sampled in the frame.
+    // Requests made during the frame are left for the next frame.
+    void TakeRequests() {
+        std::lock_guard<std::mutex> lock(m_requestMutex);
+        if (m_requestCount == 0) {
+            return;
+        }
+        if (m_frameRequestCount == 0) {
+            m_frameRequestTime = m_requestTime;
+        }
+        m_frameRequestCount += m_requestCount;
+        m_requestCount = 0;
+    }
+
+    void Report() {
+        auto now = Clock::now();
+        int64_t wallTime = std::chrono::duration_cast<std::chrono::microseconds>(now - m_reportStartTime).count();
+        if (wallTime < 1000000) {
+            return;
+        }
+        int64_t cpuTime = GetProcessCpuTime();
+        double cpuUsage = 100.0 * (cpuTime - m_reportStartCpuTime) / wallTime; // 100% == one core
+        // Latency is measured from the oldest request reflected by each presented frame.
+        double latencyAvg = m_latencyCount > 0 ? 0.001 * m_latencySum / m_latencyCount : 0.0;
+        DEBUG_PRINT(
+            L"cpu: %.1f%%, frames: %d, presents: %d, requests: %d, request-to-present: avg %.2f ms, max %.2f ms\n",
+            cpuUsage, m_frameCount, m_presentCount, m_requestStatCount, latencyAvg, 0.001 * m_latencyMax);
+
+        m_reportStartTime = now;
+        m_reportStartCpuTime = cpuTime;
+        m_frameCount = 0;
+        m_presentCount = 0;
+        m_requestStatCount = 0;
+        m_latencyCount = 0;
+        m_latencySum = 0;
+        m_latencyMax = 0;
+    }
+
+    static int64_t Now() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now().time_since_epoch()).count();
+    }
+
+    // Returns user + kernel time of this process in microseconds.
+    static int64_t GetProcessCpuTime() {
+        FILETIME creationTime{}, exitTime{}, kernelTime{}, userTime{};
+        if (!GetProcessTimes(GetCurrentProcess(), &creationTime, &exitTime, &kernelTime, &userTime)) {
+            return 0;
+        }
+        auto toMicroseconds = [](const FILETIME& time) {
+            ULARGE_INTEGER value{};
+            value.LowPart = time.dwLowDateTime;
+            value.HighPart = time.dwHighDateTime;
+            return static_cast<int64_t>(value.QuadPart / 10); // 100 ns units
+        };
+        return toMicroseconds(kernelTime) + toMicroseconds(userTime);
+    }
+};
+
+}
@@ -1,15 +1,20 @@
 #include <windows.h>
+#include <shellapi.h>
 #include "utility.h"
 #include "app.h"
+#include "shading_benchmark.h"
 
 extern IMGUI_IMPL_API LRESULT ImGui_ImplWin32_WndProcHandler(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam);
 
 namespace {
 lm::App app{};
 HCURSOR g_hCursor{};
+bool g_isReplaying{};
 
 LRESULT CALLBACK WindowProcedure(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam) {
-    if (ImGui_ImplWin32_WndProcHandler(hWnd, msg, wParam, lParam)) {
+    // While replaying, live input doesn't reach ImGui so that the replayed session is deterministic.
+    // Esc and closing the window still quit. ImGui still reads the window size directly, so don't resize the window.
+    if (!g_isReplaying && ImGui_ImplWin32_WndProcHandler(hWnd, msg, wParam, lParam)) {
         return 1;
     }
 
@@ -62,9 +67,113 @@ LRESULT CALLBACK WindowProcedure(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lPar
     }
     return DefWindowProc(hWnd, msg, wParam, lParam);
 }
+
+// Parses a decimal integer which is at least minValue. Leaves value unchanged and returns false otherwise.
+bool ParseInt(const wchar_t* pText, int minValue, int& value) {
+    wchar_t* pEnd = nullptr;
+    long parsed = wcstol(pText, &pEnd, 10);
+    if (pEnd == pText || *pEnd != L'\0' || parsed < minValue) {
+        return false;
+    }
+    value = static_cast<int>(parsed);
+    return true;
+}
+
+// Parses command line options:
+//   -record <path>      records app messages to <path>
+//   -replay <path>      replays app messages from <path> and quits when done
+//   -realtime           replays at the original timing instead of as fast as possible
+//   -frametimes <path>  writes frame times to <path> instead of next to the log
+//   -ondemand           renders only when input, messages or animations require a frame
+//   -idlefps <n>        caps the frame rate of frames not caused by input (animations) in on-demand mode
+//   -idleminfps <n>     wakes up <n> times per second without input in on-demand mode; 0 never wakes up
+//   -benchshading       runs the CPU shading benchmark instead of the app
+// Returns false if the options conflict.
+bool ParseCommandLine(lm::AppInitializeParams& params, bool& isShadingBenchmark) {
+    int argc = 0;
+    LPWSTR* argv = CommandLineToArgvW(GetCommandLineW(), &argc);
+    if (argv == nullptr) {
+        return true;
+    }
+    for (int i = 1; i < argc; i++) {
+        std::wstring arg = argv[i];
+        if (arg == L"-record" && i + 1 < argc) {
+            params.recordPath = argv[++i];
+        }
+        else if (arg == L"-replay" && i + 1 < argc) {
+            params.replayPath = argv[++i];
+        }
+        else if (arg == L"-realtime") {
+            params.isReplayRealTime = true;
+        }
+        else if (arg == L"-frametimes" && i + 1 < argc) {
+            params.frameTimesPath = argv[++i];
+        }
+        else if (arg == L"-ondemand") {
+            params.isOnDemandRedraw = true;
+        }
+        else if (arg == L"-idlefps" && i + 1 < argc) {
+            if (!ParseInt(argv[++i], 1, params.idleMaxFps)) {
+                MessageBox(nullptr, L"-idlefps must be a positive integer.", L"Error", MB_OK);
+            }
+        }
+        else if (arg == L"-idleminfps" && i + 1 < argc) {
+            if (!ParseInt(argv[++i], 0, params.idleMinFps)) {
+                MessageBox(nullptr, L"-idleminfps must be a non-negative integer.", L"Error", MB_OK);
+            }
+        }
+        else if (arg == L"-benchshading") {
+            isShadingBenchmark = true;
+        }
+    }
+    LocalFree(argv);
+    if (!params.recordPath.empty() && !params.replayPath.empty()) {
+        MessageBox(nullptr, L"-record and -replay can't be used together.", L"Error", MB_OK);
+        return false;
+    }
+    return true;
+}
+
+void RunShadingBenchmark() {
+    auto result = lm::ShadingBenchmark::Run();
+    const size_t BUFFER_SIZE = 1024;
+    wchar_t buffer[BUFFER_SIZE];
+    StringCbPrintf(buffer, sizeof(buffer),
+        L"%zu points, %zu materials\n"
+        L"enqueue: %.2f ms\n",
+        result.pointCount,
+        result.materialCount,
+        result.enqueueMs);
+    const wchar_t* flagNames[lm::IntegratorFlags_Count] = { L"none", L"direct", L"ambient", L"direct+ambient" };
+    for (uint32_t flags = 0; flags < lm::IntegratorFlags_Count; flags++) {
+        wchar_t line[BUFFER_SIZE];
+        StringCbPrintf(line, sizeof(line),
+            L"%s: specialized %.2f ms, virtual %.2f ms\n",
+            flagNames[flags],
+            result.specializedMs[flags],
+            result.virtualMs[flags]);
+        StringCbCat(buffer, sizeof(buffer), line);
+    }
+    wchar_t line[BUFFER_SIZE];
+    StringCbPrintf(line, sizeof(line), L"max difference: %g\n", result.maxDifference);
+    StringCbCat(buffer, sizeof(buffer), line);
+    OutputDebugString(buffer);
+    MessageBox(nullptr, buffer, L"Shading benchmark", MB_OK);
+}
 }
 
 int APIENTRY wWinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance, _In_ LPWSTR lpCmdLine, _In_ int nShowCmd) {
+    lm::AppInitializeParams params{};
+    bool isShadingBenchmark = false;
+    if (!ParseCommandLine(params, isShadingBenchmark)) {
+        return -1;
+    }
+    g_isReplaying = !params.replayPath.empty();
+    if (isShadingBenchmark) {
+        RunShadingBenchmark();
+        return 0;
+    }
+
     // Load default cursor
     g_hCursor = LoadCursor(nullptr, IDC_ARROW);
     WNDCLASSEX windowClass{};
@@ -101,7 +210,6 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance
     // App main loop
     bool isTerminated = false;
     std::thread appMain([&] {
-        lm::AppInitializeParams params{};
         params.hWnd = hWnd;
         params.width = contentWidth;
         params.height = contentHeight;
@@ -110,27 +218,30 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance
             return;
         }
         while (!isTerminated){
+            app.WaitForNextFrame();
             app.Update();
             app.Draw();
+            if (app.IsReplayFinished()) {
+                PostMessage(hWnd, WM_CLOSE, 0, 0);
+                break;
+            }
         }
         app.Finalize();
     });
 
     // Windows event loop
+    // Blocks on GetMessage so that the window thread doesn't consume CPU while idle.
     while (true) {
         MSG msg{};
-        if (PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE)) {
-            if (msg.message == WM_QUIT) {
-                isTerminated = true;
-                break;
-            }
-            TranslateMessage(&msg);
-            DispatchMessage(&msg);
-        }
-        else
-        {
-            Sleep(1);
+        if (GetMessage(&msg, nullptr, 0, 0) <= 0) {
+            isTerminated = true;
+            app.RequestRedraw(); // wake up the app main loop to let it terminate
+            break;
         }
+        TranslateMessage(&msg);
+        DispatchMessage(&msg);
+        // Any window message may change the ImGui state.
+        app.RequestRedraw();
     }
 
     appMain.join();
@@ -0,0 +1,171 @@
+#pragma once
+#include <cassert>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace lm {
+
+// A serialized app message.
+class MessageLogRecord {
+public:
+    uint32_t frameIndex{}; // frame in which the message was processed
+    int64_t timestamp{}; // microseconds since App::Inititialize() finished
+    uint16_t type{}; // AppMessageType, or MessageLogFormat::EndOfSessionType
+    std::vector<uint8_t> payload{};
+};
+
+// Binary layout of a message log:
+//   header: magic (4 bytes), version (uint32)
+//   record: frameIndex (uint32), timestamp (int64), type (uint16), payload size (uint16), payload
+// The last record is an end-of-session record holding the frame count and the time when recording stopped.
+class MessageLogFormat {
+public:
+    static constexpr char Magic[4] = { 'L', 'M', 'M', 'L' };
+    static constexpr uint32_t Version = 2;
+    static constexpr uint16_t EndOfSessionType = 0; // reserved by AppMessageType::EndOfSession
+};
+
+// Writes app messages to a binary log.
+class MessageRecorder {
+public:
+    bool Open(const std::wstring& path) {
+        m_stream.open(path, std::ios::binary | std::ios::trunc);
+        if (!m_stream) {
+            return false;
+        }
+        m_stream.write(MessageLogFormat::Magic, sizeof(MessageLogFormat::Magic));
+        Write(MessageLogFormat::Version);
+        return static_cast<bool>(m_stream);
+    }
+
+    // Writes the end-of-session record and closes the log.
+    // frameIndex and timestamp are those of the frame following the last recorded one.
+    void Close(uint32_t frameIndex, int64_t timestamp) {
+        if (!m_stream.is_open()) {
+            return;
+        }
+        MessageLogRecord record{};
+        record.frameIndex = frameIndex;
+        record.timestamp = timestamp;
+        record.type = MessageLogFormat::EndOfSessionType;
+        Write(record);
+        m_stream.close();
+    }
+
+    // Writes buffered records to the file so that they survive a crash.
+    void Flush() {
+        m_stream.flush();
+    }
+
+    void Write(const MessageLogRecord& record) {
+        assert(record.payload.size() <= UINT16_MAX);
+        Write(record.frameIndex);
+        Write(record.timestamp);
+        Write(record.type);
+        Write(static_cast<uint16_t>(record.payload.size()));
+        m_stream.write(reinterpret_cast<const char*>(record.payload.data()), record.payload.size());
+    }
+
+    bool IsOpen() const { return m_stream.is_open(); }
+private:
+    std::ofstream m_stream{};
+
+    template<typename T>
+    void Write(T value) {
+        m_stream.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+};
+
+// Reads a binary log written by MessageRecorder and hands back the records in order.
+class MessageReplayer {
+public:
+    // Loads the whole log into memory so that replaying does not touch the disk.
+    bool Open(const std::wstring& path) {
+        std::ifstream stream(path, std::ios::binary);
+        if (!stream) {
+            return false;
+        }
+        char magic[sizeof(MessageLogFormat::Magic)]{};
+        uint32_t version{};
+        stream.read(magic, sizeof(magic));
+        if (!Read(stream, version)
+            || std::char_traits<char>::compare(magic, MessageLogFormat::Magic, sizeof(magic)) != 0
+            || version != MessageLogFormat::Version) {
+            return false;
+        }
+        m_records.clear();
+        bool hasEndOfSession = false;
+        while (true) {
+            MessageLogRecord record{};
+            uint16_t payloadSize{};
+            if (!Read(stream, record.frameIndex)) {
+                break; // end of log
+            }
+            if (!Read(stream, record.timestamp) || !Read(stream, record.type) || !Read(stream, payloadSize)) {
+                break; // truncated by a crash
+            }
+            record.payload.resize(payloadSize);
+            stream.read(reinterpret_cast<char*>(record.payload.data()), payloadSize);
+            if (!stream) {
+                break; // truncated by a crash
+            }
+            if (record.type == MessageLogFormat::EndOfSessionType) {
+                m_endFrameIndex = record.frameIndex;
+                m_endTimestamp = record.timestamp;
+                hasEndOfSession = true;
+                break;
+            }
+            m_records.push_back(std::move(record));
+        }
+        if (!hasEndOfSession) {
+            // The session was not closed. Stop right after the last message.
+            m_endFrameIndex = m_records.empty() ? 0 : m_records.back().frameIndex + 1;
+            m_endTimestamp = m_records.empty() ? 0 : m_records.back().timestamp;
+        }
+        m_cursor = 0;
+        m_isOpen = true;
+        return true;
+    }
+
+    // Returns the next record which is due, or nullptr.
+    // A record is due when its frame has been reached (isRealTime == false),
+    // or when its original timestamp has elapsed (isRealTime == true).
+    const MessageLogRecord* Next(uint32_t frameIndex, int64_t timestamp, bool isRealTime) {
+        if (m_cursor >= m_records.size()) {
+            return nullptr;
+        }
+        const auto& record = m_records[m_cursor];
+        bool isDue = isRealTime ? record.timestamp <= timestamp : record.frameIndex <= frameIndex;
+        if (!isDue) {
+            return nullptr;
+        }
+        m_cursor++;
+        return &record;
+    }
+
+    bool IsOpen() const { return m_isOpen; }
+
+    // Returns true when all records have been handed out and the end of the recorded session has been reached.
+    bool IsFinished(uint32_t frameIndex, int64_t timestamp, bool isRealTime) const {
+        if (m_cursor < m_records.size()) {
+            return false;
+        }
+        return isRealTime ? m_endTimestamp <= timestamp : m_endFrameIndex <= frameIndex;
+    }
+private:
+    std::vector<MessageLogRecord> m_records{};
+    uint32_t m_endFrameIndex{};
+    int64_t m_endTimestamp{};
+    size_t m_cursor{};
+    bool m_isOpen{};
+
+    template<typename T>
+    static bool Read(std::ifstream& stream, T& value) {
+        stream.read(reinterpret_cast<char*>(&value), sizeof(T));
+        return static_cast<bool>(stream);
+    }
+};
+
+}
@@ -1,4 +1,5 @@
 #pragma once
+#include <chrono>
 #include <tuple>
 #include <Windows.h>
 #include <comdef.h>
@@ -111,6 +112,7 @@ public:
             IID_PPV_ARGS(&m_pCommandList)));
         m_swapChainWidth = width;
         m_swapChainHeight = height;
+        m_isDrawDataHashValid = false; // new buffers must be presented even if the UI is unchanged
         return true;
     }
 
@@ -155,16 +157,36 @@ public:
         m_pCommandList->ClearRenderTargetView(m_FrameObjects[swapChainIndex].hRenderTargetView, color, 1, &rect);
     }
 
-    void EndFrame() {
+    // Records the ImGui draw data and presents the frame. Returns true if the frame was presented.
+    // If skipIfUnchanged is true, isSceneDirty is false and the ImGui draw data is identical to the last presented
+    // one, the commands recorded since BeginFrame() are discarded and nothing is uploaded nor presented.
+    // isSceneDirty must be true when the commands recorded since BeginFrame() change the image (e.g. a progressive
+    // render added samples).
+    // If waitForVSync is false, presents immediately so that frames are not capped at the refresh rate.
+    bool EndFrame(bool skipIfUnchanged = false, bool isSceneDirty = false, bool waitForVSync = true) {
         UINT swapChainIndex = m_pSwapChain->GetCurrentBackBufferIndex();
 
         // ImGui `
         ImGui::EndFrame();
         ImGui::Render();
+        auto* pDrawData = ImGui::GetDrawData();
+        if (skipIfUnchanged) {
+            uint64_t drawDataHash = HashDrawData(pDrawData);
+            if (!isSceneDirty && m_isDrawDataHashValid && drawDataHash == m_drawDataHash) {
+                DiscardCommandList();
+                return false;
+            }
+            m_drawDataHash = drawDataHash;
+            m_isDrawDataHashValid = true;
+        }
+        else {
+            m_isDrawDataHashValid = false;
+        }
+
         m_pCommandList->OMSetRenderTargets(1, &m_FrameObjects[swapChainIndex].hRenderTargetView, false, nullptr);
         ID3D12DescriptorHeap* imguiHeaps[] = { m_pImGuiDescHeap };
         m_pCommandList->SetDescriptorHeaps(1, imguiHeaps);
-        ImGui_ImplDX12_RenderDrawData(ImGui::GetDrawData(), m_pCommandList);
+        ImGui_ImplDX12_RenderDrawData(pDrawData, m_pCommandList);
         ResourceBarrier(
             m_pCommandList,
             m_FrameObjects[swapChainIndex].pSwapChainBuffer,
@@ -172,19 +194,21 @@ public:
             D3D12_RESOURCE_STATE_PRESENT);
         // Tu~bg
         SubmitCommandList();
+        m_lastSubmitTime = std::chrono::steady_clock::now();
         // ̃t[̃R}hXg̎sÎ҂i_uobt@OĂȂ TLAS
         // 𓮓IɏĂ̂Łj
         // TODO: TLAS _uobt@OH
         m_pFence->SetEventOnCompletion(m_FenceValue, m_pFenceEvent);
         WaitForSingleObject(m_pFenceEvent, INFINITE);
         DXGI_PRESENT_PARAMETERS params{};
-        m_pSwapChain->Present1(1, 0, &params); // SyncInterval == 1 => wait for vsync
+        m_pSwapChain->Present1(waitForVSync ? 1 : 0, 0, &params); // SyncInterval == 1 => wait for vsync
 
         // t[̃R}hXgpӂ
         UINT nextSwapChainIndex = m_pSwapChain->GetCurrentBackBufferIndex();
 
         m_FrameObjects[nextSwapChainIndex].pCommandAllocator->Reset();
         m_pCommandList->Reset(m_FrameObjects[nextSwapChainIndex].pCommandAllocator, nullptr);
+        return true;
     }
 
     void Finalize()
@@ -215,6 +239,8 @@ public:
     // Getters
 
     bool IsInitialized() const { return m_isSwapChainInitialized; }
+    // Time when the command list of the last presented frame was submitted.
+    std::chrono::steady_clock::time_point GetLastSubmitTime() const { return m_lastSubmitTime; }
     ID3D12Device5Ptr GetDevice() { return m_pDevice; }
     ID3D12GraphicsCommandList4Ptr GetCommandList() { return m_pCommandList; }
 private:
@@ -243,6 +269,9 @@ private:
     UINT64 m_FenceValue{};
 
     ID3D12DescriptorHeapPtr m_pImGuiDescHeap{};
+    uint64_t m_drawDataHash{}; // hash of the last presented ImGui draw data
+    bool m_isDrawDataHashValid{};
+    std::chrono::steady_clock::time_point m_lastSubmitTime{};
 
 
     void EnableDebugLayer()
@@ -290,6 +319,27 @@ private:
         return nullptr;
     }
 
+    // Hashes everything that affects the rendered ImGui image.
+    static uint64_t HashDrawData(const ImDrawData* pDrawData)
+    {
+        uint64_t hash = Utility::Hash(&pDrawData->DisplayPos, sizeof(ImVec2));
+        hash = Utility::Hash(&pDrawData->DisplaySize, sizeof(ImVec2), hash);
+        hash = Utility::Hash(&pDrawData->FramebufferScale, sizeof(ImVec2), hash);
+        for (int i = 0; i < pDrawData->CmdListsCount; i++) {
+            const ImDrawList* pDrawList = pDrawData->CmdLists[i];
+            hash = Utility::Hash(pDrawList->VtxBuffer.Data, pDrawList->VtxBuffer.size_in_bytes(), hash);
+            hash = Utility::Hash(pDrawList->IdxBuffer.Data, pDrawList->IdxBuffer.size_in_bytes(), hash);
+            for (const auto& cmd : pDrawList->CmdBuffer) {
+                hash = Utility::Hash(&cmd.ClipRect, sizeof(ImVec4), hash);
+                hash = Utility::Hash(&cmd.TextureId, sizeof(ImTextureID), hash);
+                hash = Utility::Hash(&cmd.VtxOffset, sizeof(unsigned int), hash);
+                hash = Utility::Hash(&cmd.IdxOffset, sizeof(unsigned int), hash);
+                hash = Utility::Hash(&cmd.ElemCount, sizeof(unsigned int), hash);
+            }
+        }
+        return hash;
+    }
+
     ID3D12DescriptorHeapPtr CreateDescriptorHeap(D3D12_DESCRIPTOR_HEAP_TYPE type, UINT count, bool shaderVisible)
     {
         assert(m_pDevice != nullptr);
@@ -369,6 +419,18 @@ private:
         m_pQueue->Signal(m_pFence, m_FenceValue);
     }
 
+    // Drops the commands recorded for the current frame without executing them.
+    // The allocator is not in use by the GPU because every frame waits for its command list to complete.
+    void DiscardCommandList()
+    {
+        assert(m_pCommandList != nullptr);
+
+        UINT swapChainIndex = m_pSwapChain->GetCurrentBackBufferIndex();
+        m_pCommandList->Close();
+        m_FrameObjects[swapChainIndex].pCommandAllocator->Reset();
+        m_pCommandList->Reset(m_FrameObjects[swapChainIndex].pCommandAllocator, nullptr);
+    }
+
     void WaitForCommandCompletion()
     {
         m_FenceValue++;
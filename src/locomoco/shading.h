@@ -0,0 +1,457 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace lm {
+
+// CPU shading of surface points.
+// SpecializedShader takes one queue of shading points per material and dispatches each queue to a kernel which is
+// instantiated for the combination of BSDF type, texture presence and integrator flags, so that the
+// per-point loop has no branches and can be vectorized.
+// VirtualShader is the generic implementation which shades each point through virtual calls.
+
+enum class BsdfType : uint32_t {
+    Lambert,
+    BlinnPhong,
+    Emissive,
+    Count,
+};
+
+// Features of the integrator. Combined as bit flags.
+enum IntegratorFlags : uint32_t {
+    IntegratorFlags_None = 0,
+    IntegratorFlags_DirectLight = 1 << 0, // adds a directional light
+    IntegratorFlags_Ambient = 1 << 1, // adds a constant ambient light
+    IntegratorFlags_Count = 1 << 2, // number of combinations
+};
+
+// RGB texture sampled with nearest filtering and repeat addressing.
+class Texture {
+public:
+    int width{};
+    int height{};
+    std::vector<float> texels{}; // RGB, row major
+
+    void Sample(float u, float v, float& r, float& g, float& b) const {
+        Sample(texels.data(), width, height, u, v, r, g, b);
+    }
+
+    // Shading kernels call this with the members loaded before the loop.
+    static void Sample(
+        const float* pTexels, int width, int height, float u, float v, float& r, float& g, float& b)
+    {
+        assert(width > 0 && height > 0);
+        int x = Wrap(u, width);
+        int y = Wrap(v, height);
+        // A 32-bit index, so that compilers can turn the loads into gathers.
+        int index = (y * width + x) * 3;
+        r = pTexels[index];
+        g = pTexels[index + 1];
+        b = pTexels[index + 2];
+    }
+private:
+    // Returns the texel index of coordinate with repeat addressing. |coordinate| must be less than 2^31.
+    // Only conversions and integer arithmetic, which vectorize; floor() and modulo don't.
+    static int Wrap(float coordinate, int size) {
+        float fraction = coordinate - static_cast<float>(static_cast<int>(coordinate)); // (-1, 1)
+        int texel = static_cast<int>((fraction + 1.0f) * size); // [0, 2 * size]
+        texel = texel >= size ? texel - size : texel;
+        return (std::min)(texel, size - 1);
+    }
+};
+
+class Material {
+public:
+    BsdfType bsdfType{};
+    float albedo[3]{}; // used when pTexture is null
+    const Texture* pTexture{}; // replaces albedo if not null
+    float specular{}; // BlinnPhong: weight of the specular lobe
+    float exponent{ 1.0f }; // BlinnPhong: shininess
+    float emission[3]{}; // Emissive: radiance
+};
+
+class Lighting {
+public:
+    float direction[3]{ 0.0f, 1.0f, 0.0f }; // normalized, towards the light
+    float radiance[3]{ 1.0f, 1.0f, 1.0f };
+    float ambient[3]{};
+};
+
+// Shading points in SoA layout. Directions must be normalized.
+class ShadingPoints {
+public:
+    std::vector<float> nx{}, ny{}, nz{}; // shading normal
+    std::vector<float> wox{}, woy{}, woz{}; // direction towards the viewer
+    std::vector<float> u{}, v{}; // texture coordinates
+    std::vector<float> r{}, g{}, b{}; // output radiance
+
+    size_t Size() const { return nx.size(); }
+
+    void Resize(size_t size) {
+        for (auto* pArray : { &nx, &ny, &nz, &wox, &woy, &woz, &u, &v, &r, &g, &b }) {
+            pArray->resize(size);
+        }
+    }
+
+    void Clear() {
+        Resize(0);
+    }
+};
+
+namespace shading_detail {
+
+constexpr float InvPi = 0.318309886f;
+
+// The helpers below avoid floating point comparisons and libm calls, which keep compilers from vectorizing the
+// kernels: a comparison may trap on NaN and can't be turned into a select without -fno-trapping-math.
+
+// max(x, 0)
+inline float MaxZero(float x) {
+    return 0.5f * (x + std::abs(x));
+}
+
+// log2(x) for x >= 0. Absolute error is below 1e-6; x == 0 gives -127.
+inline float FastLog2(float x) {
+    // x = 2^exponent * (1 + t) with 1 + t in [sqrt(0.5), sqrt(2)), split with integer arithmetic.
+    const int32_t sqrtHalfBits = 0x3F3504F3;
+    int32_t bits = std::bit_cast<int32_t>(x) - sqrtHalfBits;
+    int32_t exponent = bits >> 23;
+    float t = std::bit_cast<float>((bits & 0x7FFFFF) + sqrtHalfBits) - 1.0f;
+    // log2(1 + t) / t, least squares fit
+    float p = -0.146203578f;
+    p = p * t + 0.23420988f;
+    p = p * t - 0.248821795f;
+    p = p * t + 0.287075609f;
+    p = p * t - 0.360241979f;
+    p = p * t + 0.48092404f;
+    p = p * t - 0.721352756f;
+    p = p * t + 1.4426949f;
+    return static_cast<float>(exponent) + t * p;
+}
+
+// 2^x for x < 127. Relative error is below 3e-7; results below 2^-125 are clamped to about 2^-125.
+inline float FastExp2(float x) {
+    // Truncation instead of floor(), which doesn't vectorize on x64 unless -fno-trapping-math.
+    int32_t integer = static_cast<int32_t>(x);
+    float f = x - static_cast<float>(integer);
+    // 2^f for f in (-1, 1), least squares fit
+    float p = 1.50252636e-05f;
+    p = p * f + 0.00015661931f;
+    p = p * f + 0.00133397488f;
+    p = p * f + 0.009616578f;
+    p = p * f + 0.055503767f;
+    p = p * f + 0.24022679f;
+    p = p * f + 0.693147242f;
+    p = p * f + 1.0f;
+    int32_t exponent = (std::max)(integer, -125);
+    return std::bit_cast<float>(std::bit_cast<int32_t>(p) + exponent * (1 << 23));
+}
+
+// x^y for x in [0, 1] and y > 0. Relative error grows with y; about 2e-5 for y up to 128.
+inline float FastPow(float x, float y) {
+    return FastExp2(y * FastLog2(x));
+}
+
+// Radiance leaving towards wo. All BSDFs go through this function so that the specialized and the generic
+// implementations produce the same results; the branches fold away when Bsdf and Flags are constants.
+template<BsdfType Bsdf, uint32_t Flags>
+inline void ShadePoint(
+    const Material& material,
+    const Lighting& lighting,
+    float nx, float ny, float nz,
+    float wox, float woy, float woz,
+    float albedoR, float albedoG, float albedoB,
+    float& r, float& g, float& b)
+{
+    if constexpr (Bsdf == BsdfType::Emissive) {
+        r = material.emission[0];
+        g = material.emission[1];
+        b = material.emission[2];
+    }
+    else {
+        // Accumulate in locals and store once.
+        float radianceR = 0.0f;
+        float radianceG = 0.0f;
+        float radianceB = 0.0f;
+        float diffuseWeight = Bsdf == BsdfType::BlinnPhong ? 1.0f - material.specular : 1.0f;
+        if constexpr ((Flags & IntegratorFlags_DirectLight) != 0) {
+            float lx = lighting.direction[0];
+            float ly = lighting.direction[1];
+            float lz = lighting.direction[2];
+            float cosTheta = MaxZero(nx * lx + ny * ly + nz * lz);
+            float diffuse = diffuseWeight * InvPi * cosTheta;
+            float specular = 0.0f;
+            if constexpr (Bsdf == BsdfType::BlinnPhong) {
+                float hx = lx + wox;
+                float hy = ly + woy;
+                float hz = lz + woz;
+                // cosH^exponent == (cosH^2)^(exponent / 2), which needs no square root to normalize h.
+                float dotH = MaxZero(nx * hx + ny * hy + nz * hz);
+                float cosHSquared = dotH * dotH / (hx * hx + hy * hy + hz * hz + 1e-12f);
+                float normalization = (material.exponent + 8.0f) * (InvPi / 8.0f);
+                float cosHPower = FastPow(cosHSquared, 0.5f * material.exponent);
+                specular = material.specular * normalization * cosHPower * cosTheta;
+            }
+            radianceR += (albedoR * diffuse + specular) * lighting.radiance[0];
+            radianceG += (albedoG * diffuse + specular) * lighting.radiance[1];
+            radianceB += (albedoB * diffuse + specular) * lighting.radiance[2];
+        }
+        if constexpr ((Flags & IntegratorFlags_Ambient) != 0) {
+            radianceR += diffuseWeight * albedoR * lighting.ambient[0];
+            radianceG += diffuseWeight * albedoG * lighting.ambient[1];
+            radianceB += diffuseWeight * albedoB * lighting.ambient[2];
+        }
+        r = radianceR;
+        g = radianceG;
+        b = radianceB;
+    }
+}
+
+// Shades count points which all use material.
+// The arrays are __restrict parameters, so that the compiler doesn't need runtime alias checks.
+// Kernels are called through ShadeKernelTable; inlining them may lose the __restrict information.
+template<BsdfType Bsdf, bool HasTexture, uint32_t Flags>
+void ShadeKernel(
+    const Material& material,
+    const Lighting& lighting,
+    const float* __restrict nx, const float* __restrict ny, const float* __restrict nz,
+    const float* __restrict wox, const float* __restrict woy, const float* __restrict woz,
+    const float* __restrict u, const float* __restrict v,
+    float* __restrict r, float* __restrict g, float* __restrict b,
+    size_t count)
+{
+    // Local copies, so that the compiler doesn't have to prove that the outputs don't alias the constants.
+    const Material localMaterial = material;
+    const Lighting localLighting = lighting;
+    const float materialAlbedoR = material.albedo[0];
+    const float materialAlbedoG = material.albedo[1];
+    const float materialAlbedoB = material.albedo[2];
+    const float* pTexels = nullptr;
+    int textureWidth = 0;
+    int textureHeight = 0;
+    if constexpr (HasTexture && Bsdf != BsdfType::Emissive) {
+        pTexels = material.pTexture->texels.data();
+        textureWidth = material.pTexture->width;
+        textureHeight = material.pTexture->height;
+    }
+    for (size_t i = 0; i < count; i++) {
+        float albedoR = materialAlbedoR;
+        float albedoG = materialAlbedoG;
+        float albedoB = materialAlbedoB;
+        if constexpr (HasTexture && Bsdf != BsdfType::Emissive) {
+            Texture::Sample(pTexels, textureWidth, textureHeight, u[i], v[i], albedoR, albedoG, albedoB);
+        }
+        ShadePoint<Bsdf, Flags>(
+            localMaterial, localLighting,
+            nx[i], ny[i], nz[i], wox[i], woy[i], woz[i], albedoR, albedoG, albedoB, r[i], g[i], b[i]);
+    }
+}
+
+using ShadeKernelFunc = void (*)(
+    const Material&, const Lighting&,
+    const float*, const float*, const float*, const float*, const float*, const float*, const float*, const float*,
+    float*, float*, float*,
+    size_t);
+
+constexpr size_t ShadeKernelCount = static_cast<size_t>(BsdfType::Count) * 2 * IntegratorFlags_Count;
+
+constexpr size_t GetShadeKernelIndex(BsdfType bsdfType, bool hasTexture, uint32_t flags) {
+    return (static_cast<size_t>(bsdfType) * 2 + (hasTexture ? 1 : 0)) * IntegratorFlags_Count + flags;
+}
+
+template<size_t Index>
+constexpr ShadeKernelFunc GetShadeKernel() {
+    constexpr auto bsdfType = static_cast<BsdfType>(Index / (2 * IntegratorFlags_Count));
+    constexpr bool hasTexture = (Index / IntegratorFlags_Count) % 2 == 1;
+    constexpr auto flags = static_cast<uint32_t>(Index % IntegratorFlags_Count);
+    static_assert(GetShadeKernelIndex(bsdfType, hasTexture, flags) == Index);
+    return &ShadeKernel<bsdfType, hasTexture, flags>;
+}
+
+template<size_t... Indices>
+constexpr std::array<ShadeKernelFunc, sizeof...(Indices)> MakeShadeKernelTable(std::index_sequence<Indices...>) {
+    return { GetShadeKernel<Indices>()... };
+}
+
+// All kernel instances, indexed by GetShadeKernelIndex().
+inline constexpr auto ShadeKernelTable = MakeShadeKernelTable(std::make_index_sequence<ShadeKernelCount>());
+
+}
+
+// Shades points with kernels specialized at compile time.
+// Points come in one queue per material, so that each queue is shaded by a single kernel call without sorting,
+// gathering nor scattering. A tracer should append each hit to the queue of its material directly;
+// Enqueue() is for callers which only have a flat array.
+class SpecializedShader {
+public:
+    // Shades queues[i] with materials[i].
+    static void Shade(
+        std::vector<ShadingPoints>& queues, const std::vector<Material>& materials, const Lighting& lighting,
+        uint32_t flags)
+    {
+        assert(queues.size() == materials.size());
+        assert(flags < IntegratorFlags_Count);
+        for (size_t materialId = 0; materialId < materials.size(); materialId++) {
+            auto& queue = queues[materialId];
+            if (queue.Size() == 0) {
+                continue;
+            }
+            const auto& material = materials[materialId];
+            assert(material.bsdfType < BsdfType::Count);
+            // Unknown BSDF types are shaded as Emissive, like VirtualShader.
+            auto bsdfType = material.bsdfType < BsdfType::Count ? material.bsdfType : BsdfType::Emissive;
+            auto kernelIndex = shading_detail::GetShadeKernelIndex(bsdfType, material.pTexture != nullptr, flags);
+            shading_detail::ShadeKernelTable[kernelIndex](
+                material, lighting,
+                queue.nx.data(), queue.ny.data(), queue.nz.data(),
+                queue.wox.data(), queue.woy.data(), queue.woz.data(),
+                queue.u.data(), queue.v.data(),
+                queue.r.data(), queue.g.data(), queue.b.data(),
+                queue.Size());
+        }
+    }
+
+    // Appends points[i] to queues[materialIds[i]], keeping the order within each queue.
+    static void Enqueue(
+        const ShadingPoints& points, const std::vector<uint32_t>& materialIds, std::vector<ShadingPoints>& queues)
+    {
+        assert(materialIds.size() == points.Size());
+        // Grow the queues first, then copy one array at a time; copying all arrays at once thrashes the cache
+        // with queues.size() streams each.
+        std::vector<size_t> starts(queues.size());
+        std::vector<size_t> sizes(queues.size());
+        for (size_t i = 0; i < queues.size(); i++) {
+            starts[i] = queues[i].Size();
+            sizes[i] = queues[i].Size();
+        }
+        for (auto materialId : materialIds) {
+            assert(materialId < queues.size());
+            sizes[materialId]++;
+        }
+        for (size_t i = 0; i < queues.size(); i++) {
+            queues[i].Resize(sizes[i]);
+        }
+        std::vector<float*> destinations(queues.size());
+        for (auto pArray : {
+            &ShadingPoints::nx, &ShadingPoints::ny, &ShadingPoints::nz,
+            &ShadingPoints::wox, &ShadingPoints::woy, &ShadingPoints::woz,
+            &ShadingPoints::u, &ShadingPoints::v })
+        {
+            for (size_t i = 0; i < queues.size(); i++) {
+                destinations[i] = (queues[i].*pArray).data() + starts[i];
+            }
+            const auto& source = points.*pArray;
+            for (size_t i = 0; i < source.size(); i++) {
+                *destinations[materialIds[i]]++ = source[i];
+            }
+        }
+    }
+};
+
+// Generic material interface, dispatched at runtime for every shading point.
+class IShadingMaterial {
+public:
+    virtual ~IShadingMaterial() {}
+
+    virtual void Shade(
+        const Lighting& lighting, uint32_t flags, const ShadingPoints& points, size_t index,
+        float& r, float& g, float& b) const = 0;
+};
+
+template<BsdfType Bsdf>
+class ShadingMaterial : public IShadingMaterial {
+public:
+    explicit ShadingMaterial(const Material& material) : m_material(material) { }
+
+    virtual void Shade(
+        const Lighting& lighting, uint32_t flags, const ShadingPoints& points, size_t index,
+        float& r, float& g, float& b) const override
+    {
+        float albedoR = m_material.albedo[0];
+        float albedoG = m_material.albedo[1];
+        float albedoB = m_material.albedo[2];
+        if (m_material.pTexture != nullptr && Bsdf != BsdfType::Emissive) {
+            m_material.pTexture->Sample(points.u[index], points.v[index], albedoR, albedoG, albedoB);
+        }
+        switch (flags) {
+        case IntegratorFlags_None:
+            ShadePoint<IntegratorFlags_None>(lighting, points, index, albedoR, albedoG, albedoB, r, g, b);
+            break;
+        case IntegratorFlags_DirectLight:
+            ShadePoint<IntegratorFlags_DirectLight>(lighting, points, index, albedoR, albedoG, albedoB, r, g, b);
+            break;
+        case IntegratorFlags_Ambient:
+            ShadePoint<IntegratorFlags_Ambient>(lighting, points, index, albedoR, albedoG, albedoB, r, g, b);
+            break;
+        case IntegratorFlags_DirectLight | IntegratorFlags_Ambient:
+            ShadePoint<IntegratorFlags_DirectLight | IntegratorFlags_Ambient>(
+                lighting, points, index, albedoR, albedoG, albedoB, r, g, b);
+            break;
+        default:
+            assert(false && "unknown integrator flags");
+            break;
+        }
+    }
+private:
+    Material m_material{};
+
+    template<uint32_t Flags>
+    void ShadePoint(
+        const Lighting& lighting, const ShadingPoints& points, size_t index,
+        float albedoR, float albedoG, float albedoB, float& r, float& g, float& b) const
+    {
+        shading_detail::ShadePoint<Bsdf, Flags>(
+            m_material, lighting,
+            points.nx[index], points.ny[index], points.nz[index],
+            points.wox[index], points.woy[index], points.woz[index],
+            albedoR, albedoG, albedoB, r, g, b);
+    }
+};
+
+// Shades points one by one through IShadingMaterial. Reference for SpecializedShader.
+class VirtualShader {
+public:
+    explicit VirtualShader(const std::vector<Material>& materials) {
+        for (const auto& material : materials) {
+            switch (material.bsdfType) {
+            case BsdfType::Lambert:
+                m_materials.push_back(std::make_unique<ShadingMaterial<BsdfType::Lambert>>(material));
+                break;
+            case BsdfType::BlinnPhong:
+                m_materials.push_back(std::make_unique<ShadingMaterial<BsdfType::BlinnPhong>>(material));
+                break;
+            case BsdfType::Emissive:
+                m_materials.push_back(std::make_unique<ShadingMaterial<BsdfType::Emissive>>(material));
+                break;
+            default:
+                // Unknown BSDF types are shaded as Emissive, like SpecializedShader.
+                assert(false && "unknown BSDF type");
+                m_materials.push_back(std::make_unique<ShadingMaterial<BsdfType::Emissive>>(material));
+                break;
+            }
+        }
+    }
+
+    // Shades points[i] with the material materialIds[i].
+    void Shade(
+        ShadingPoints& points, const std::vector<uint32_t>& materialIds, const Lighting& lighting, uint32_t flags) const
+    {
+        assert(materialIds.size() == points.Size());
+        assert(flags < IntegratorFlags_Count);
+        for (size_t i = 0; i < points.Size(); i++) {
+            assert(materialIds[i] < m_materials.size());
+            m_materials[materialIds[i]]->Shade(lighting, flags, points, i, points.r[i], points.g[i], points.b[i]);
+        }
+    }
+private:
+    std::vector<std::unique_ptr<IShadingMaterial>> m_materials{};
+};
+
+}
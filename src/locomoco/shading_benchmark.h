@@ -0,0 +1,139 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+#include "shading.h"
+
+namespace lm {
+
+class ShadingBenchmarkResult {
+public:
+    size_t pointCount{};
+    size_t materialCount{};
+    double enqueueMs{}; // SpecializedShader::Enqueue(); not paid by a tracer which writes hits to the queues directly
+    double specializedMs[IntegratorFlags_Count]{}; // SpecializedShader::Shade() for each integrator flags
+    double virtualMs[IntegratorFlags_Count]{}; // VirtualShader::Shade() for each integrator flags
+    float maxDifference{}; // max absolute difference of the outputs over all integrator flags
+};
+
+// Compares SpecializedShader against VirtualShader on a scene which mixes all material kinds.
+// Times are the best of all iterations.
+class ShadingBenchmark {
+public:
+    static ShadingBenchmarkResult Run(size_t pointCount = 1 << 20, size_t materialCount = 64, int iterationCount = 10) {
+        std::mt19937 random(12345);
+        std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+
+        // Textures
+        std::vector<Texture> textures(4);
+        for (auto& texture : textures) {
+            texture.width = 256;
+            texture.height = 256;
+            texture.texels.resize(static_cast<size_t>(texture.width) * texture.height * 3);
+            for (auto& texel : texture.texels) {
+                texel = uniform(random);
+            }
+        }
+
+        // Materials: every BSDF type, half of them textured.
+        std::vector<Material> materials(materialCount);
+        for (size_t i = 0; i < materialCount; i++) {
+            auto& material = materials[i];
+            material.bsdfType = static_cast<BsdfType>(i % static_cast<size_t>(BsdfType::Count));
+            for (int c = 0; c < 3; c++) {
+                material.albedo[c] = uniform(random);
+                material.emission[c] = uniform(random);
+            }
+            material.pTexture = (i / static_cast<size_t>(BsdfType::Count)) % 2 == 0 ? &textures[i % textures.size()] : nullptr;
+            material.specular = 0.5f * uniform(random);
+            material.exponent = 1.0f + 127.0f * uniform(random);
+        }
+
+        Lighting lighting{};
+        SetNormalized(lighting.direction, 0.3f, 0.8f, 0.5f);
+        lighting.ambient[0] = lighting.ambient[1] = lighting.ambient[2] = 0.1f;
+
+        // Shading points on random orientations. Materials change every 16 points on average,
+        // like neighboring pixels which mostly hit the same surface.
+        ShadingPoints points{};
+        points.Resize(pointCount);
+        std::vector<uint32_t> materialIds(pointCount);
+        std::uniform_int_distribution<uint32_t> materialDistribution(0, static_cast<uint32_t>(materialCount - 1));
+        for (size_t i = 0; i < pointCount; i++) {
+            bool isNewSurface = i == 0 || uniform(random) < 1.0f / 16;
+            materialIds[i] = isNewSurface ? materialDistribution(random) : materialIds[i - 1];
+            float n[3];
+            float wo[3];
+            SetNormalized(n, uniform(random) - 0.5f, uniform(random), uniform(random) - 0.5f);
+            SetNormalized(wo, uniform(random) - 0.5f, uniform(random), uniform(random) - 0.5f);
+            points.nx[i] = n[0];
+            points.ny[i] = n[1];
+            points.nz[i] = n[2];
+            points.wox[i] = wo[0];
+            points.woy[i] = wo[1];
+            points.woz[i] = wo[2];
+            points.u[i] = 4.0f * uniform(random);
+            points.v[i] = 4.0f * uniform(random);
+        }
+
+        ShadingBenchmarkResult result{};
+        result.pointCount = pointCount;
+        result.materialCount = materialCount;
+
+        std::vector<ShadingPoints> queues(materialCount);
+        result.enqueueMs = Measure(iterationCount, [&] {
+            for (auto& queue : queues) {
+                queue.Clear();
+            }
+            SpecializedShader::Enqueue(points, materialIds, queues);
+        });
+
+        VirtualShader virtualShader(materials);
+        for (uint32_t flags = 0; flags < IntegratorFlags_Count; flags++) {
+            result.specializedMs[flags] = Measure(iterationCount, [&] {
+                SpecializedShader::Shade(queues, materials, lighting, flags);
+            });
+            result.virtualMs[flags] = Measure(iterationCount, [&] {
+                virtualShader.Shade(points, materialIds, lighting, flags);
+            });
+
+            // Enqueue() keeps the order within a material.
+            std::vector<size_t> cursors(materialCount);
+            for (size_t i = 0; i < pointCount; i++) {
+                const auto& queue = queues[materialIds[i]];
+                size_t j = cursors[materialIds[i]]++;
+                result.maxDifference = (std::max)({
+                    result.maxDifference,
+                    std::abs(queue.r[j] - points.r[i]),
+                    std::abs(queue.g[j] - points.g[i]),
+                    std::abs(queue.b[j] - points.b[i]) });
+            }
+        }
+        return result;
+    }
+private:
+    static void SetNormalized(float* v, float x, float y, float z) {
+        float invLength = 1.0f / std::sqrt((std::max)(x * x + y * y + z * z, 1e-12f));
+        v[0] = x * invLength;
+        v[1] = y * invLength;
+        v[2] = z * invLength;
+    }
+
+    // Returns the best time of iterationCount runs in milliseconds.
+    template<typename F>
+    static double Measure(int iterationCount, F&& function) {
+        double best = 0.0;
+        for (int i = 0; i < iterationCount; i++) {
+            auto start = std::chrono::steady_clock::now();
+            function();
+            double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            best = i == 0 ? elapsed : (std::min)(best, elapsed);
+        }
+        return best;
+    }
+};
+
+}
@@ -1,4 +1,6 @@
 #pragma once
+#include <cstdint>
+#include <cstring>
 #include <strsafe.h>
 
 // Print formatted string on debug console.
@@ -46,6 +48,26 @@ public:
         FormatMessage(FORMAT_MESSAGE_FROM_SYSTEM, nullptr, hr, 0, hrStr, BUFFER_SIZE, nullptr);
         OutputDebugString(hrStr);
     }
+
+    // FNV-1a based hash, processing 8 bytes per step. Not for cryptographic use.
+    // The multiplication only carries differences upwards, so the high half is folded back after each step.
+    // Pass the previous result as seed to hash multiple buffers.
+    static uint64_t Hash(const void* pData, size_t size, uint64_t seed = 14695981039346656037ull) {
+        const uint64_t prime = 1099511628211ull;
+        const auto* pBytes = static_cast<const uint8_t*>(pData);
+        uint64_t hash = seed;
+        size_t i = 0;
+        for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+            uint64_t word;
+            std::memcpy(&word, pBytes + i, sizeof(uint64_t));
+            hash = (hash ^ word) * prime;
+            hash ^= hash >> 32;
+        }
+        for (; i < size; i++) {
+            hash = (hash ^ pBytes[i]) * prime;
+        }
+        return hash;
+    }
 };
 
 }